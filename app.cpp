@@ -8,6 +8,12 @@
 #include <fstream>
 #include <limits>
 #include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <thread>
+#include <atomic>
+#include <set>
+#include <filesystem>
 
 using namespace std;
 
@@ -25,6 +31,145 @@ struct Income
     string date;
 };
 
+// A closed, immutable block of history. Rows are kept only in encoded form
+// (sorted by date, delta-encoded YYYYMMDD dates, dictionary indexes for
+// categories/sources, varint cents); the totals are precomputed so reports
+// never have to decode the rows.
+struct ArchiveSegment
+{
+    string closedThrough;
+    vector<string> dictionary;
+    size_t expenseCount = 0;
+    size_t incomeCount = 0;
+    string expenseData;
+    string incomeData;
+    map<string, long long> categoryCents;
+    map<string, long long> monthCents;
+    long long expenseCents = 0;
+    long long incomeCents = 0;
+};
+
+// Aggregates for one ledger in whole cents, so merging partial results
+// from several ledgers gives the same totals in any order.
+struct LedgerTotals
+{
+    long long incomeCents = 0;
+    long long expenseCents = 0;
+    map<string, long long> categoryCents;
+    map<string, long long> monthCents;
+
+    void merge(const LedgerTotals &other)
+    {
+        incomeCents += other.incomeCents;
+        expenseCents += other.expenseCents;
+        for (auto it = other.categoryCents.begin(); it != other.categoryCents.end(); ++it)
+        {
+            categoryCents[it->first] += it->second;
+        }
+        for (auto it = other.monthCents.begin(); it != other.monthCents.end(); ++it)
+        {
+            monthCents[it->first] += it->second;
+        }
+    }
+};
+
+// Appends straight into a large buffer and hands it to the file only when
+// full, so exports never build intermediate row strings.
+class ExportWriter
+{
+private:
+    ofstream outFile;
+    vector<char> buffer;
+    size_t used = 0;
+
+public:
+    explicit ExportWriter(const string &path, size_t capacity = 1 << 20)
+        : outFile(path, ios::binary), buffer(capacity)
+    {
+    }
+
+    ~ExportWriter()
+    {
+        flush();
+    }
+
+    bool good() const
+    {
+        return outFile.good();
+    }
+
+    void flush()
+    {
+        if (used > 0)
+        {
+            outFile.write(buffer.data(), used);
+            used = 0;
+        }
+    }
+
+    void write(const char *data, size_t length)
+    {
+        if (used + length > buffer.size())
+        {
+            flush();
+            if (length > buffer.size())
+            {
+                outFile.write(data, length);
+                return;
+            }
+        }
+        copy(data, data + length, buffer.data() + used);
+        used += length;
+    }
+
+    void write(const string &text)
+    {
+        write(text.data(), text.size());
+    }
+
+    template <size_t N>
+    void write(const char (&literal)[N])
+    {
+        write(literal, N - 1);
+    }
+
+    void write(char c)
+    {
+        if (used == buffer.size())
+        {
+            flush();
+        }
+        buffer[used++] = c;
+    }
+
+    void writeAmount(double amount)
+    {
+        char text[32];
+        int length = snprintf(text, sizeof(text), "%.2f", amount);
+        write(text, length);
+    }
+
+    void writeUint64(unsigned long long value)
+    {
+        char bytes[8];
+        for (int i = 0; i < 8; ++i)
+        {
+            bytes[i] = static_cast<char>(value >> (8 * i));
+        }
+        write(bytes, sizeof(bytes));
+    }
+
+    void writeUint32(unsigned long value)
+    {
+        char bytes[4];
+        for (int i = 0; i < 4; ++i)
+        {
+            bytes[i] = static_cast<char>(value >> (8 * i));
+        }
+        write(bytes, sizeof(bytes));
+    }
+};
+
 class BudgetManager
 {
 private:
@@ -33,15 +178,22 @@ private:
     map<string, double> budgetLimits;
     map<string, double> spent;
     map<string, double> monthlyBudget;
+    vector<ArchiveSegment> archive;
+    string archivedThrough;
+    bool archiveCorrupt = false;
     string currentUser;
 
-    void saveData() const
+    // Writes to a temporary file and renames it over the ledger, so a failed
+    // save leaves the previous ledger intact.
+    bool saveData() const
     {
-        ofstream outFile(currentUser + ".dat");
+        string path = currentUser + ".dat";
+        string tempPath = path + ".tmp";
+        ofstream outFile(tempPath);
         if (!outFile)
         {
             cerr << "Error: Unable to open file for saving data." << endl;
-            return;
+            return false;
         }
 
         outFile << expenses.size() << endl;
@@ -75,22 +227,37 @@ private:
         }
 
         outFile.close();
+        error_code error;
+        if (!outFile.good())
+        {
+            filesystem::remove(tempPath, error);
+            cerr << "Error: Failed to write data file." << endl;
+            return false;
+        }
+        filesystem::rename(tempPath, path, error);
+        if (error)
+        {
+            filesystem::remove(tempPath, error);
+            cerr << "Error: Failed to replace data file." << endl;
+            return false;
+        }
+        return true;
     }
 
-    void loadData()
+    bool loadData(string &error)
     {
         ifstream inFile(currentUser + ".dat");
         if (!inFile)
         {
-            cerr << "Error: Unable to open file for loading data." << endl;
-            return;
+            error = "Unable to open file for loading data.";
+            return false;
         }
 
         size_t numExpenses;
         if (!(inFile >> numExpenses))
         {
-            cerr << "Error: Failed to read number of expenses." << endl;
-            return;
+            error = "Failed to read number of expenses.";
+            return false;
         }
         inFile.ignore();
         expenses.clear();
@@ -102,9 +269,10 @@ private:
             stringstream ss(line);
             if (!(ss >> expense.amount))
             {
-                cerr << "Error: Failed to read expense amount." << endl;
-                return;
+                error = "Failed to read expense amount.";
+                return false;
             }
+            ss.ignore();
             getline(ss, expense.category, ',');
             getline(ss, expense.date, ',');
             expenses.push_back(expense);
@@ -113,8 +281,8 @@ private:
         size_t numIncomes;
         if (!(inFile >> numIncomes))
         {
-            cerr << "Error: Failed to read number of incomes." << endl;
-            return;
+            error = "Failed to read number of incomes.";
+            return false;
         }
         inFile.ignore();
         incomes.clear();
@@ -126,147 +294,791 @@ private:
             stringstream ss(line);
             if (!(ss >> income.amount))
             {
-                cerr << "Error: Failed to read income amount." << endl;
-                return;
+                error = "Failed to read income amount.";
+                return false;
             }
+            ss.ignore();
             getline(ss, income.source, ',');
             getline(ss, income.date, ',');
             incomes.push_back(income);
         }
 
-        size_t numBudgetLimits;
-        if (!(inFile >> numBudgetLimits))
+        size_t numBudgetLimits;
+        if (!(inFile >> numBudgetLimits))
+        {
+            error = "Failed to read number of budget limits.";
+            return false;
+        }
+        inFile.ignore();
+        budgetLimits.clear();
+        for (size_t i = 0; i < numBudgetLimits; ++i)
+        {
+            string line;
+            getline(inFile, line);
+            stringstream ss(line);
+            string category;
+            double limit;
+            if (!(getline(ss, category, ',') && (ss >> limit)))
+            {
+                error = "Failed to read budget limit.";
+                return false;
+            }
+            budgetLimits[category] = limit;
+        }
+
+        size_t numSpent;
+        if (!(inFile >> numSpent))
+        {
+            error = "Failed to read number of spent entries.";
+            return false;
+        }
+        inFile.ignore();
+        spent.clear();
+        for (size_t i = 0; i < numSpent; ++i)
+        {
+            string line;
+            getline(inFile, line);
+            stringstream ss(line);
+            string category;
+            double amount;
+            if (!(getline(ss, category, ',') && (ss >> amount)))
+            {
+                error = "Failed to read spent amount.";
+                return false;
+            }
+            spent[category] = amount;
+        }
+
+        size_t numMonthlyBudget;
+        if (!(inFile >> numMonthlyBudget))
+        {
+            error = "Failed to read number of monthly budgets.";
+            return false;
+        }
+        inFile.ignore();
+        monthlyBudget.clear();
+        for (size_t i = 0; i < numMonthlyBudget; ++i)
+        {
+            string line;
+            getline(inFile, line);
+            stringstream ss(line);
+            string month;
+            double amount;
+            if (!(getline(ss, month, ',') && (ss >> amount)))
+            {
+                error = "Failed to read monthly budget.";
+                return false;
+            }
+            monthlyBudget[month] = amount;
+        }
+
+        inFile.close();
+        return true;
+    }
+
+    bool saveArchiveSegment(const ArchiveSegment &segment) const
+    {
+        ofstream outFile(currentUser + ".arc", ios::binary | ios::app);
+        if (!outFile)
+        {
+            cerr << "Error: Unable to open archive file for saving data." << endl;
+            return false;
+        }
+
+        string payload = encodeSegment(segment);
+        string header = "PBMA";
+        putVarint(header, payload.size());
+        outFile.write(header.data(), header.size());
+        outFile.write(payload.data(), payload.size());
+        outFile.close();
+        if (!outFile.good())
+        {
+            cerr << "Error: Failed to write archive segment." << endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool loadArchive(string &error)
+    {
+        archive.clear();
+        archivedThrough.clear();
+        archiveCorrupt = false;
+
+        ifstream inFile(currentUser + ".arc", ios::binary);
+        if (!inFile)
+        {
+            return true;
+        }
+        string data((istreambuf_iterator<char>(inFile)), istreambuf_iterator<char>());
+        inFile.close();
+
+        size_t pos = 0;
+        while (pos < data.size())
+        {
+            unsigned long long length;
+            if (data.compare(pos, 4, "PBMA") != 0)
+            {
+                error = "Corrupt archive segment header.";
+                archiveCorrupt = true;
+                break;
+            }
+            pos += 4;
+            if (!getVarint(data, pos, length) || length > data.size() - pos)
+            {
+                error = "Failed to read archive segment length.";
+                archiveCorrupt = true;
+                break;
+            }
+            ArchiveSegment segment;
+            if (!decodeSegment(data.substr(pos, length), segment))
+            {
+                error = "Failed to read archive segment.";
+                archiveCorrupt = true;
+                break;
+            }
+            pos += length;
+            if (segment.closedThrough > archivedThrough)
+            {
+                archivedThrough = segment.closedThrough;
+            }
+            archive.push_back(move(segment));
+        }
+        dropClosedRows();
+        return !archiveCorrupt;
+    }
+
+    // Live rows in a closed month are already in the archive (for example
+    // after a close whose ledger rewrite was interrupted); keep one copy.
+    void dropClosedRows()
+    {
+        expenses.erase(remove_if(expenses.begin(), expenses.end(), [this](const Expense &expense)
+                                 { return isArchivableDate(expense.date) && isClosedDate(expense.date); }),
+                       expenses.end());
+        incomes.erase(remove_if(incomes.begin(), incomes.end(), [this](const Income &income)
+                                { return isArchivableDate(income.date) && isClosedDate(income.date); }),
+                      incomes.end());
+    }
+
+    void loadUser()
+    {
+        string error;
+        if (!loadData(error))
+        {
+            cerr << "Error: " << error << endl;
+        }
+        if (!loadArchive(error))
+        {
+            cerr << "Error: " << error << endl;
+        }
+    }
+
+    bool validateDate(const string &date) const
+    {
+        if (date.length() != 10 || date[4] != '-' || date[7] != '-')
+        {
+            return false;
+        }
+        for (char c : date)
+        {
+            if (!isdigit(c) && c != '-')
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool validateAmount(double amount) const
+    {
+        return amount > 0;
+    }
+
+    static string getMonth(const string &date)
+    {
+        return date.substr(0, 7);
+    }
+
+    static bool validateMonth(const string &month)
+    {
+        if (month.length() != 7 || month[4] != '-')
+        {
+            return false;
+        }
+        for (size_t i = 0; i < month.length(); ++i)
+        {
+            if (i != 4 && !isdigit(month[i]))
+            {
+                return false;
+            }
+        }
+        int monthNumber = stoi(month.substr(5, 2));
+        return month.substr(0, 4) != "0000" && monthNumber >= 1 && monthNumber <= 12;
+    }
+
+    static string currentMonth()
+    {
+        time_t now = time(nullptr);
+        char buffer[16];
+        strftime(buffer, sizeof(buffer), "%Y-%m", localtime(&now));
+        return buffer;
+    }
+
+    static bool isArchivableDate(const string &date)
+    {
+        return date.length() == 10 && date[7] == '-' && validateMonth(date.substr(0, 7)) &&
+               isdigit(date[8]) && isdigit(date[9]);
+    }
+
+    static unsigned long packMonth(const string &month)
+    {
+        return stoul(month.substr(0, 4)) * 100 + stoul(month.substr(5, 2));
+    }
+
+    static string unpackMonth(unsigned long packed)
+    {
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%04lu-%02lu", packed / 100, packed % 100);
+        return buffer;
+    }
+
+    static unsigned long packDate(const string &date)
+    {
+        return packMonth(date) * 100 + stoul(date.substr(8, 2));
+    }
+
+    static long long toCents(double amount)
+    {
+        return llround(amount * 100);
+    }
+
+    static void putVarint(string &out, unsigned long long value)
+    {
+        while (value >= 0x80)
+        {
+            out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+
+    static bool getVarint(const string &in, size_t &pos, unsigned long long &value)
+    {
+        value = 0;
+        for (int shift = 0; shift < 64 && pos < in.size(); shift += 7)
+        {
+            unsigned char byte = static_cast<unsigned char>(in[pos++]);
+            value |= static_cast<unsigned long long>(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static void putString(string &out, const string &value)
+    {
+        putVarint(out, value.size());
+        out += value;
+    }
+
+    static bool getString(const string &in, size_t &pos, string &value)
+    {
+        unsigned long long length;
+        if (!getVarint(in, pos, length) || length > in.size() - pos)
+        {
+            return false;
+        }
+        value = in.substr(pos, length);
+        pos += length;
+        return true;
+    }
+
+    static string encodeSegment(const ArchiveSegment &segment)
+    {
+        string out;
+        putString(out, segment.closedThrough);
+        putVarint(out, segment.dictionary.size());
+        for (const auto &entry : segment.dictionary)
+        {
+            putString(out, entry);
+        }
+        putVarint(out, segment.expenseCount);
+        putString(out, segment.expenseData);
+        putVarint(out, segment.incomeCount);
+        putString(out, segment.incomeData);
+
+        putVarint(out, segment.categoryCents.size());
+        for (auto it = segment.categoryCents.begin(); it != segment.categoryCents.end(); ++it)
+        {
+            size_t id = find(segment.dictionary.begin(), segment.dictionary.end(), it->first) - segment.dictionary.begin();
+            putVarint(out, id);
+            putVarint(out, it->second);
+        }
+
+        putVarint(out, segment.monthCents.size());
+        unsigned long previousMonth = 0;
+        for (auto it = segment.monthCents.begin(); it != segment.monthCents.end(); ++it)
+        {
+            unsigned long month = packMonth(it->first);
+            putVarint(out, month - previousMonth);
+            putVarint(out, it->second);
+            previousMonth = month;
+        }
+
+        putVarint(out, segment.expenseCents);
+        putVarint(out, segment.incomeCents);
+        return out;
+    }
+
+    static bool decodeSegment(const string &in, ArchiveSegment &segment)
+    {
+        size_t pos = 0;
+        unsigned long long count, value;
+        if (!getString(in, pos, segment.closedThrough) || !getVarint(in, pos, count) || count > in.size() - pos)
+        {
+            return false;
+        }
+        segment.dictionary.resize(count);
+        for (auto &entry : segment.dictionary)
+        {
+            if (!getString(in, pos, entry))
+            {
+                return false;
+            }
+        }
+        // Every row is at least three one-byte varints.
+        if (!getVarint(in, pos, value) || !getString(in, pos, segment.expenseData) ||
+            value > segment.expenseData.size() / 3)
+        {
+            return false;
+        }
+        segment.expenseCount = value;
+        if (!getVarint(in, pos, value) || !getString(in, pos, segment.incomeData) ||
+            value > segment.incomeData.size() / 3)
+        {
+            return false;
+        }
+        segment.incomeCount = value;
+
+        if (!getVarint(in, pos, count))
+        {
+            return false;
+        }
+        for (unsigned long long i = 0; i < count; ++i)
+        {
+            unsigned long long id;
+            if (!getVarint(in, pos, id) || id >= segment.dictionary.size() || !getVarint(in, pos, value))
+            {
+                return false;
+            }
+            segment.categoryCents[segment.dictionary[id]] = value;
+        }
+
+        if (!getVarint(in, pos, count))
+        {
+            return false;
+        }
+        unsigned long long month = 0;
+        for (unsigned long long i = 0; i < count; ++i)
+        {
+            unsigned long long delta;
+            if (!getVarint(in, pos, delta) || !getVarint(in, pos, value))
+            {
+                return false;
+            }
+            month += delta;
+            segment.monthCents[unpackMonth(month)] = value;
+        }
+
+        if (!getVarint(in, pos, value))
+        {
+            return false;
+        }
+        segment.expenseCents = value;
+        if (!getVarint(in, pos, value))
+        {
+            return false;
+        }
+        segment.incomeCents = value;
+        return pos == in.size();
+    }
+
+    static unsigned long dictionaryIndex(ArchiveSegment &segment, map<string, unsigned long> &index, const string &entry)
+    {
+        auto it = index.find(entry);
+        if (it != index.end())
+        {
+            return it->second;
+        }
+        unsigned long id = segment.dictionary.size();
+        segment.dictionary.push_back(entry);
+        index[entry] = id;
+        return id;
+    }
+
+    long long archivedMonthCents(const string &month) const
+    {
+        long long total = 0;
+        for (const auto &segment : archive)
+        {
+            auto it = segment.monthCents.find(month);
+            if (it != segment.monthCents.end())
+            {
+                total += it->second;
+            }
+        }
+        return total;
+    }
+
+    bool isClosedDate(const string &date) const
+    {
+        return !archivedThrough.empty() && getMonth(date) <= archivedThrough;
+    }
+
+    void printExpenses(const vector<Expense> &expensesToPrint) const
+    {
+        if (expensesToPrint.empty())
+        {
+            cout << "No expenses found." << endl;
+            return;
+        }
+        cout << left << setw(10) << "Amount" << setw(20) << "Category" << "Date" << endl;
+        for (const auto &expense : expensesToPrint)
+        {
+            cout << fixed << setprecision(2) << setw(10) << expense.amount
+                 << setw(20) << expense.category << expense.date << endl;
+        }
+    }
+
+    void printIncomes(const vector<Income> &incomesToPrint) const
+    {
+        if (incomesToPrint.empty())
+        {
+            cout << "No income found." << endl;
+            return;
+        }
+        cout << left << setw(10) << "Amount" << setw(20) << "Source" << "Date" << endl;
+        for (const auto &income : incomesToPrint)
+        {
+            cout << fixed << setprecision(2) << setw(10) << income.amount
+                 << setw(20) << income.source << income.date << endl;
+        }
+    }
+
+    static void printSpendTables(ostream &report, const LedgerTotals &totals)
+    {
+        report << left << setw(20) << "Category" << "Spent" << endl;
+        for (auto it = totals.categoryCents.begin(); it != totals.categoryCents.end(); ++it)
+        {
+            report << left << setw(20) << it->first << it->second / 100.0 << endl;
+        }
+        report << left << setw(20) << "Month" << "Spent" << endl;
+        for (auto it = totals.monthCents.begin(); it != totals.monthCents.end(); ++it)
+        {
+            report << left << setw(20) << it->first << it->second / 100.0 << endl;
+        }
+    }
+
+    template <typename Visitor>
+    static bool forEachArchivedRow(const ArchiveSegment &segment, const string &data, size_t count, Visitor &visit)
+    {
+        size_t pos = 0;
+        unsigned long long date = 0, delta, id, cents;
+        char text[32];
+        string dateText;
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (!getVarint(data, pos, delta) || !getVarint(data, pos, id) ||
+                id >= segment.dictionary.size() || !getVarint(data, pos, cents))
+            {
+                cerr << "Error: Failed to read archived row." << endl;
+                return false;
+            }
+            date += delta;
+            int length = snprintf(text, sizeof(text), "%04llu-%02llu-%02llu", date / 10000, date / 100 % 100, date % 100);
+            dateText.assign(text, length);
+            visit(cents / 100.0, segment.dictionary[id], dateText);
+        }
+        return true;
+    }
+
+    // Visits archived rows (oldest first) and then live rows, decoding the
+    // archive on the fly instead of materializing it.
+    template <typename Visitor>
+    bool forEachExpense(Visitor visit) const
+    {
+        for (const auto &segment : archive)
+        {
+            if (!forEachArchivedRow(segment, segment.expenseData, segment.expenseCount, visit))
+            {
+                return false;
+            }
+        }
+        for (const auto &expense : expenses)
+        {
+            visit(expense.amount, expense.category, expense.date);
+        }
+        return true;
+    }
+
+    template <typename Visitor>
+    bool forEachIncome(Visitor visit) const
+    {
+        for (const auto &segment : archive)
+        {
+            if (!forEachArchivedRow(segment, segment.incomeData, segment.incomeCount, visit))
+            {
+                return false;
+            }
+        }
+        for (const auto &income : incomes)
+        {
+            visit(income.amount, income.source, income.date);
+        }
+        return true;
+    }
+
+    size_t expenseRowCount() const
+    {
+        size_t count = expenses.size();
+        for (const auto &segment : archive)
+        {
+            count += segment.expenseCount;
+        }
+        return count;
+    }
+
+    size_t incomeRowCount() const
+    {
+        size_t count = incomes.size();
+        for (const auto &segment : archive)
         {
-            cerr << "Error: Failed to read number of budget limits." << endl;
-            return;
+            count += segment.incomeCount;
         }
-        inFile.ignore();
-        budgetLimits.clear();
-        for (size_t i = 0; i < numBudgetLimits; ++i)
+        return count;
+    }
+
+    // Totals from the ledger rows, then the figures trackBudget and
+    // trackMonthlyBudget print: each budget with its spent and remaining
+    // amounts, and each month's budget, expenses and remainder.
+    template <typename Visitor>
+    bool forEachAggregate(const LedgerTotals &totals, Visitor visit) const
+    {
+        static const string total = "total", income = "income", expense = "expenses";
+        static const string category = "category", month = "month";
+        static const string budget = "budget", budgetSpent = "budget_spent", budgetRemaining = "budget_remaining";
+        static const string monthBudget = "month_budget", monthExpenses = "month_expenses",
+                            monthRemaining = "month_remaining";
+        visit(totals.incomeCents / 100.0, total, income);
+        visit(totals.expenseCents / 100.0, total, expense);
+        for (auto it = totals.categoryCents.begin(); it != totals.categoryCents.end(); ++it)
         {
-            string line;
-            getline(inFile, line);
-            stringstream ss(line);
-            string category;
-            double limit;
-            if (!(getline(ss, category, ',') && (ss >> limit)))
-            {
-                cerr << "Error: Failed to read budget limit." << endl;
-                return;
-            }
-            budgetLimits[category] = limit;
+            visit(it->second / 100.0, category, it->first);
         }
-
-        size_t numSpent;
-        if (!(inFile >> numSpent))
+        for (auto it = totals.monthCents.begin(); it != totals.monthCents.end(); ++it)
         {
-            cerr << "Error: Failed to read number of spent entries." << endl;
-            return;
+            visit(it->second / 100.0, month, it->first);
         }
-        inFile.ignore();
-        spent.clear();
-        for (size_t i = 0; i < numSpent; ++i)
+        for (auto it = budgetLimits.begin(); it != budgetLimits.end(); ++it)
         {
-            string line;
-            getline(inFile, line);
-            stringstream ss(line);
-            string category;
-            double amount;
-            if (!(getline(ss, category, ',') && (ss >> amount)))
-            {
-                cerr << "Error: Failed to read spent amount." << endl;
-                return;
-            }
-            spent[category] = amount;
+            auto spentIt = spent.find(it->first);
+            double spentAmount = spentIt != spent.end() ? spentIt->second : 0;
+            visit(it->second, budget, it->first);
+            visit(spentAmount, budgetSpent, it->first);
+            visit(it->second - spentAmount, budgetRemaining, it->first);
         }
+        for (auto it = monthlyBudget.begin(); it != monthlyBudget.end(); ++it)
+        {
+            auto monthIt = totals.monthCents.find(it->first);
+            double monthSpent = monthIt != totals.monthCents.end() ? monthIt->second / 100.0 : 0;
+            visit(it->second, monthBudget, it->first);
+            visit(monthSpent, monthExpenses, it->first);
+            visit(it->second - monthSpent, monthRemaining, it->first);
+        }
+        return true;
+    }
 
-        size_t numMonthlyBudget;
-        if (!(inFile >> numMonthlyBudget))
+    size_t aggregateRowCount(const LedgerTotals &totals) const
+    {
+        return 2 + totals.categoryCents.size() + totals.monthCents.size() +
+               3 * budgetLimits.size() + 3 * monthlyBudget.size();
+    }
+
+    static void writeCsvField(ExportWriter &out, const string &field)
+    {
+        if (field.find_first_of(",\"\r\n") == string::npos)
         {
-            cerr << "Error: Failed to read number of monthly budgets." << endl;
+            out.write(field);
             return;
         }
-        inFile.ignore();
-        monthlyBudget.clear();
-        for (size_t i = 0; i < numMonthlyBudget; ++i)
+        out.write('"');
+        for (char c : field)
         {
-            string line;
-            getline(inFile, line);
-            stringstream ss(line);
-            string month;
-            double amount;
-            if (!(getline(ss, month, ',') && (ss >> amount)))
+            if (c == '"')
             {
-                cerr << "Error: Failed to read monthly budget." << endl;
-                return;
+                out.write('"');
             }
-            monthlyBudget[month] = amount;
+            out.write(c);
         }
-
-        inFile.close();
+        out.write('"');
     }
 
-    bool validateDate(const string &date) const
+    static void writeJsonString(ExportWriter &out, const string &text)
     {
-        if (date.length() != 10 || date[4] != '-' || date[7] != '-')
-        {
-            return false;
-        }
-        for (char c : date)
+        out.write('"');
+        for (char c : text)
         {
-            if (!isdigit(c) && c != '-')
+            if (c == '"' || c == '\\')
             {
-                return false;
+                out.write('\\');
+                out.write(c);
+            }
+            else if (static_cast<unsigned char>(c) < 0x20)
+            {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                out.write(escaped, 6);
+            }
+            else
+            {
+                out.write(c);
             }
         }
-        return true;
+        out.write('"');
     }
 
-    bool validateAmount(double amount) const
+    // Rows are (amount, first, second); columns names the three fields. A
+    // row source returns false if it could not produce every row.
+    template <typename Rows>
+    static bool writeCsv(ExportWriter &out, const vector<string> &columns, Rows rows)
     {
-        return amount > 0;
+        out.write(columns[0]);
+        out.write(',');
+        out.write(columns[1]);
+        out.write(',');
+        out.write(columns[2]);
+        out.write('\n');
+        return rows([&out](double amount, const string &first, const string &second)
+                    {
+            out.writeAmount(amount);
+            out.write(',');
+            writeCsvField(out, first);
+            out.write(',');
+            writeCsvField(out, second);
+            out.write('\n'); });
     }
 
-    static string getMonth(const string &date)
+    template <typename Rows>
+    static bool writeJsonLines(ExportWriter &out, const vector<string> &columns, Rows rows)
     {
-        return date.substr(0, 7);
+        return rows([&out, &columns](double amount, const string &first, const string &second)
+                    {
+            out.write("{\"");
+            out.write(columns[0]);
+            out.write("\":");
+            out.writeAmount(amount);
+            out.write(",\"");
+            out.write(columns[1]);
+            out.write("\":");
+            writeJsonString(out, first);
+            out.write(",\"");
+            out.write(columns[2]);
+            out.write("\":");
+            writeJsonString(out, second);
+            out.write("}\n"); });
     }
 
-    void printExpenses(const vector<Expense> &expensesToPrint) const
+    // Columnar layout: "PBMC", version, column count, row count, then each
+    // column's type (0 = int64 cents, 1 = string) and name, followed by the
+    // column data in order. String columns are rowCount + 1 uint64 offsets
+    // and then the concatenated bytes. All integers are little-endian.
+    template <typename Rows>
+    static bool writeColumnar(ExportWriter &out, const vector<string> &columns, size_t rowCount, Rows rows)
     {
-        if (expensesToPrint.empty())
+        out.write("PBMC");
+        out.writeUint32(1);
+        out.writeUint32(columns.size());
+        out.writeUint64(rowCount);
+        for (size_t i = 0; i < columns.size(); ++i)
         {
-            cout << "No expenses found." << endl;
-            return;
+            out.write(static_cast<char>(i == 0 ? 0 : 1));
+            out.writeUint32(columns[i].size());
+            out.write(columns[i]);
         }
-        cout << left << setw(10) << "Amount" << setw(20) << "Category" << "Date" << endl;
-        for (const auto &expense : expensesToPrint)
+
+        if (!rows([&out](double amount, const string &, const string &)
+                  { out.writeUint64(static_cast<unsigned long long>(toCents(amount))); }))
         {
-            cout << fixed << setprecision(2) << setw(10) << expense.amount
-                 << setw(20) << expense.category << expense.date << endl;
+            return false;
+        }
+        for (int column = 1; column <= 2; ++column)
+        {
+            unsigned long long offset = 0;
+            out.writeUint64(offset);
+            if (!rows([&out, &offset, column](double, const string &first, const string &second)
+                      {
+                offset += (column == 1 ? first : second).size();
+                out.writeUint64(offset); }))
+            {
+                return false;
+            }
+            if (!rows([&out, column](double, const string &first, const string &second)
+                      { out.write(column == 1 ? first : second); }))
+            {
+                return false;
+            }
         }
+        return true;
     }
 
-    void printIncomes(const vector<Income> &incomesToPrint) const
+    template <typename Rows>
+    static bool writeExport(const string &format, const string &path, const vector<string> &columns,
+                            size_t rowCount, Rows rows)
     {
-        if (incomesToPrint.empty())
+        if (format != "csv" && format != "jsonl" && format != "columnar")
         {
-            cout << "No income found." << endl;
-            return;
+            cerr << "Error: Unknown export format. Use csv, jsonl or columnar." << endl;
+            return false;
         }
-        cout << left << setw(10) << "Amount" << setw(20) << "Source" << "Date" << endl;
-        for (const auto &income : incomesToPrint)
+        bool written;
         {
-            cout << fixed << setprecision(2) << setw(10) << income.amount
-                 << setw(20) << income.source << income.date << endl;
+            ExportWriter out(path);
+            if (!out.good())
+            {
+                cerr << "Error: Unable to open file for export." << endl;
+                return false;
+            }
+            if (format == "csv")
+            {
+                written = writeCsv(out, columns, rows);
+            }
+            else if (format == "jsonl")
+            {
+                written = writeJsonLines(out, columns, rows);
+            }
+            else
+            {
+                written = writeColumnar(out, columns, rowCount, rows);
+            }
+            out.flush();
+            written = written && out.good();
+        }
+        if (!written)
+        {
+            cerr << "Error: Failed to write export file; removed incomplete " << path << "." << endl;
+            remove(path.c_str());
+            return false;
         }
+        return true;
     }
 
 public:
     void setUser(const string &username)
     {
         currentUser = username;
-        loadData();
+        loadUser();
     }
 
     void addExpense(double amount, const string &category, const string &date)
@@ -281,6 +1093,11 @@ public:
             cerr << "Error: Invalid date format. Use YYYY-MM-DD." << endl;
             return;
         }
+        if (isClosedDate(date))
+        {
+            cerr << "Error: Month " << getMonth(date) << " is closed." << endl;
+            return;
+        }
         Expense newExpense = {amount, category, date};
         expenses.push_back(newExpense);
         spent[category] += amount;
@@ -307,6 +1124,11 @@ public:
             cerr << "Error: Invalid date format. Use YYYY-MM-DD." << endl;
             return;
         }
+        if (isClosedDate(date))
+        {
+            cerr << "Error: Month " << getMonth(date) << " is closed." << endl;
+            return;
+        }
         Income newIncome = {amount, source, date};
         incomes.push_back(newIncome);
         saveData();
@@ -335,6 +1157,11 @@ public:
             cerr << "Error: Invalid date format. Use YYYY-MM-DD." << endl;
             return;
         }
+        if (isClosedDate(newDate))
+        {
+            cerr << "Error: Month " << getMonth(newDate) << " is closed." << endl;
+            return;
+        }
         Expense &expense = expenses[index];
         string oldCategory = expense.category;
         string oldDate = expense.date;
@@ -384,6 +1211,11 @@ public:
             cerr << "Error: Invalid date format. Use YYYY-MM-DD." << endl;
             return;
         }
+        if (isClosedDate(newDate))
+        {
+            cerr << "Error: Month " << getMonth(newDate) << " is closed." << endl;
+            return;
+        }
         Income &income = incomes[index];
         income.amount = newAmount;
         income.source = newSource;
@@ -446,7 +1278,17 @@ public:
             totalExpenses += expense.amount;
         }
 
+        for (const auto &segment : archive)
+        {
+            totalIncome += segment.incomeCents / 100.0;
+            totalExpenses += segment.expenseCents / 100.0;
+        }
+
         cout << fixed << setprecision(2);
+        if (!archivedThrough.empty())
+        {
+            cout << "Archived Through: " << archivedThrough << endl;
+        }
         cout << "Total Income: " << totalIncome << endl;
         cout << "Total Expenses: " << totalExpenses << endl;
         cout << "Remaining Budget: " << totalIncome - totalExpenses << endl;
@@ -485,7 +1327,7 @@ public:
         {
             const string &month = it->first;
             double budget = it->second;
-            double totalExpenses = 0;
+            double totalExpenses = archivedMonthCents(month) / 100.0;
             for (const auto &expense : expenses)
             {
                 if (getMonth(expense.date) == month)
@@ -500,10 +1342,294 @@ public:
         }
     }
 
+    void closeMonths(const string &throughMonth)
+    {
+        if (!validateMonth(throughMonth))
+        {
+            cerr << "Error: Invalid month format. Use YYYY-MM." << endl;
+            return;
+        }
+        if (throughMonth >= currentMonth())
+        {
+            cerr << "Error: Only months before " << currentMonth() << " can be closed." << endl;
+            return;
+        }
+        if (archiveCorrupt)
+        {
+            cerr << "Error: Archive file is corrupt; refusing to close more months." << endl;
+            return;
+        }
+        if (!archivedThrough.empty() && throughMonth <= archivedThrough)
+        {
+            cerr << "Error: Months through " << archivedThrough << " are already closed." << endl;
+            return;
+        }
+
+        vector<Expense> closedExpenses, openExpenses;
+        for (const auto &expense : expenses)
+        {
+            bool closing = isArchivableDate(expense.date) && getMonth(expense.date) <= throughMonth;
+            (closing ? closedExpenses : openExpenses).push_back(expense);
+        }
+        vector<Income> closedIncomes, openIncomes;
+        for (const auto &income : incomes)
+        {
+            bool closing = isArchivableDate(income.date) && getMonth(income.date) <= throughMonth;
+            (closing ? closedIncomes : openIncomes).push_back(income);
+        }
+
+        stable_sort(closedExpenses.begin(), closedExpenses.end(),
+                    [](const Expense &a, const Expense &b) { return a.date < b.date; });
+        stable_sort(closedIncomes.begin(), closedIncomes.end(),
+                    [](const Income &a, const Income &b) { return a.date < b.date; });
+
+        ArchiveSegment segment;
+        map<string, unsigned long> index;
+        segment.closedThrough = throughMonth;
+        segment.expenseCount = closedExpenses.size();
+        segment.incomeCount = closedIncomes.size();
+
+        unsigned long previousDate = 0;
+        for (const auto &expense : closedExpenses)
+        {
+            unsigned long date = packDate(expense.date);
+            long long cents = toCents(expense.amount);
+            putVarint(segment.expenseData, date - previousDate);
+            putVarint(segment.expenseData, dictionaryIndex(segment, index, expense.category));
+            putVarint(segment.expenseData, cents);
+            segment.categoryCents[expense.category] += cents;
+            segment.monthCents[getMonth(expense.date)] += cents;
+            segment.expenseCents += cents;
+            previousDate = date;
+        }
+
+        previousDate = 0;
+        for (const auto &income : closedIncomes)
+        {
+            unsigned long date = packDate(income.date);
+            long long cents = toCents(income.amount);
+            putVarint(segment.incomeData, date - previousDate);
+            putVarint(segment.incomeData, dictionaryIndex(segment, index, income.source));
+            putVarint(segment.incomeData, cents);
+            segment.incomeCents += cents;
+            previousDate = date;
+        }
+
+        // Append the segment first, then rewrite the ledger without the closed
+        // rows; if either write fails, cut the archive back to its old size.
+        string archivePath = currentUser + ".arc";
+        error_code error;
+        uintmax_t archiveSize = filesystem::exists(archivePath, error) ? filesystem::file_size(archivePath, error) : 0;
+        if (error)
+        {
+            cerr << "Error: Unable to read archive file size. Months were not closed." << endl;
+            return;
+        }
+        bool closed = saveArchiveSegment(segment);
+        if (closed)
+        {
+            expenses.swap(openExpenses);
+            incomes.swap(openIncomes);
+            closed = saveData();
+            if (!closed)
+            {
+                expenses.swap(openExpenses);
+                incomes.swap(openIncomes);
+            }
+        }
+        if (!closed)
+        {
+            filesystem::resize_file(archivePath, archiveSize, error);
+            cerr << "Error: Months were not closed." << endl;
+            return;
+        }
+        archivedThrough = throughMonth;
+        archive.push_back(move(segment));
+        cout << "Closed " << closedExpenses.size() << " expenses and " << closedIncomes.size()
+             << " incomes through " << throughMonth << "." << endl;
+    }
+
+    LedgerTotals collectTotals() const
+    {
+        LedgerTotals totals;
+        for (const auto &income : incomes)
+        {
+            totals.incomeCents += toCents(income.amount);
+        }
+        for (const auto &expense : expenses)
+        {
+            long long cents = toCents(expense.amount);
+            totals.expenseCents += cents;
+            totals.categoryCents[expense.category] += cents;
+            totals.monthCents[getMonth(expense.date)] += cents;
+        }
+        for (const auto &segment : archive)
+        {
+            totals.incomeCents += segment.incomeCents;
+            totals.expenseCents += segment.expenseCents;
+            for (auto it = segment.categoryCents.begin(); it != segment.categoryCents.end(); ++it)
+            {
+                totals.categoryCents[it->first] += it->second;
+            }
+            for (auto it = segment.monthCents.begin(); it != segment.monthCents.end(); ++it)
+            {
+                totals.monthCents[it->first] += it->second;
+            }
+        }
+        return totals;
+    }
+
+    void generateConsolidatedReport(const vector<string> &requestedUsers) const
+    {
+        vector<string> usernames;
+        set<string> seen;
+        for (const auto &username : requestedUsers)
+        {
+            if (seen.insert(username).second)
+            {
+                usernames.push_back(username);
+            }
+        }
+        if (usernames.empty())
+        {
+            cout << "No users given." << endl;
+            return;
+        }
+
+        // Each worker pulls the next ledger off a shared counter and folds it
+        // into its own partial, so no locking is needed while loading.
+        size_t workerCount = min<size_t>(usernames.size(), max(1u, thread::hardware_concurrency()));
+        vector<LedgerTotals> perUser(usernames.size());
+        vector<string> problems(usernames.size());
+        vector<LedgerTotals> partials(workerCount);
+        atomic<size_t> next(0);
+        vector<thread> workers;
+        for (size_t w = 0; w < workerCount; ++w)
+        {
+            workers.emplace_back([&, w]()
+                                 {
+                for (size_t i = next++; i < usernames.size(); i = next++)
+                {
+                    try
+                    {
+                        if (!ifstream(usernames[i] + ".dat"))
+                        {
+                            problems[i] = "no ledger file";
+                            continue;
+                        }
+                        BudgetManager ledger;
+                        ledger.currentUser = usernames[i];
+                        string error;
+                        if (!ledger.loadData(error) || !ledger.loadArchive(error))
+                        {
+                            problems[i] = error;
+                            continue;
+                        }
+                        perUser[i] = ledger.collectTotals();
+                        partials[w].merge(perUser[i]);
+                    }
+                    catch (const exception &e)
+                    {
+                        problems[i] = string("failed to load: ") + e.what();
+                    }
+                } });
+        }
+        for (auto &worker : workers)
+        {
+            worker.join();
+        }
+
+        // Pairwise tree merge of the partials; each round halves the count.
+        for (size_t step = 1; step < workerCount; step *= 2)
+        {
+            vector<thread> mergers;
+            for (size_t i = 0; i + step < workerCount; i += 2 * step)
+            {
+                mergers.emplace_back([&partials, i, step]()
+                                     { partials[i].merge(partials[i + step]); });
+            }
+            for (auto &merger : mergers)
+            {
+                merger.join();
+            }
+        }
+        const LedgerTotals &combined = partials[0];
+
+        ostringstream report;
+        report << fixed << setprecision(2);
+        report << left << setw(20) << "User" << setw(15) << "Income" << setw(15) << "Expenses" << "Remaining" << endl;
+        for (size_t i = 0; i < usernames.size(); ++i)
+        {
+            if (!problems[i].empty())
+            {
+                report << left << setw(20) << usernames[i] << "skipped: " << problems[i] << endl;
+                continue;
+            }
+            report << left << setw(20) << usernames[i]
+                   << setw(15) << perUser[i].incomeCents / 100.0
+                   << setw(15) << perUser[i].expenseCents / 100.0
+                   << (perUser[i].incomeCents - perUser[i].expenseCents) / 100.0 << endl;
+        }
+        report << left << setw(20) << "All Users"
+               << setw(15) << combined.incomeCents / 100.0
+               << setw(15) << combined.expenseCents / 100.0
+               << (combined.incomeCents - combined.expenseCents) / 100.0 << endl;
+
+        for (size_t i = 0; i < usernames.size(); ++i)
+        {
+            if (problems[i].empty())
+            {
+                report << endl << "== " << usernames[i] << " ==" << endl;
+                printSpendTables(report, perUser[i]);
+            }
+        }
+        report << endl << "== All Users ==" << endl;
+        printSpendTables(report, combined);
+        cout << report.str();
+    }
+
+    void exportData(const string &dataset, const string &format, const string &path) const
+    {
+        bool exported;
+        if (dataset == "expenses")
+        {
+            exported = writeExport(format, path, {"amount", "category", "date"}, expenseRowCount(),
+                                   [this](auto visit)
+                                   { return forEachExpense(visit); });
+        }
+        else if (dataset == "incomes")
+        {
+            exported = writeExport(format, path, {"amount", "source", "date"}, incomeRowCount(),
+                                   [this](auto visit)
+                                   { return forEachIncome(visit); });
+        }
+        else if (dataset == "aggregates")
+        {
+            LedgerTotals totals = collectTotals();
+            exported = writeExport(format, path, {"amount", "kind", "key"}, aggregateRowCount(totals),
+                                   [this, &totals](auto visit)
+                                   { return forEachAggregate(totals, visit); });
+        }
+        else
+        {
+            cerr << "Error: Unknown dataset. Use expenses, incomes or aggregates." << endl;
+            return;
+        }
+        if (exported)
+        {
+            cout << "Exported " << dataset << " to " << path << "." << endl;
+        }
+    }
+
     void addUserProfile(const string &username)
     {
         currentUser = username;
         saveData();
+        string error;
+        if (!loadArchive(error))
+        {
+            cerr << "Error: " << error << endl;
+        }
         cout << "User profile added: " << username << endl;
     }
 
@@ -517,7 +1643,7 @@ public:
         if (authenticateUser(username))
         {
             currentUser = username;
-            loadData();
+            loadUser();
             cout << "Switched to user profile: " << username << endl;
         }
         else
@@ -547,6 +1673,9 @@ public:
             cout << "14. Track Monthly Budget\n";
             cout << "15. Add User Profile\n";
             cout << "16. Switch User Profile\n";
+            cout << "17. Close Months\n";
+            cout << "18. Consolidated Report\n";
+            cout << "19. Export Data\n";
             cout << "0. Exit\n";
             cout << "Choose an option: ";
             int choice;
@@ -680,6 +1809,43 @@ public:
                 switchUserProfile(username);
                 break;
             }
+            case 17:
+            {
+                string month;
+                cout << "Enter last month to close (YYYY-MM): ";
+                getline(cin, month);
+                closeMonths(month);
+                break;
+            }
+            case 18:
+            {
+                string line, username;
+                vector<string> usernames;
+                cout << "Enter usernames separated by commas: ";
+                getline(cin, line);
+                stringstream ss(line);
+                while (getline(ss, username, ','))
+                {
+                    username.erase(0, username.find_first_not_of(' '));
+                    username.erase(username.find_last_not_of(' ') + 1);
+                    if (!username.empty())
+                    {
+                        usernames.push_back(username);
+                    }
+                }
+                generateConsolidatedReport(usernames);
+                break;
+            }
+            case 19:
+            {
+                string dataset, format, path;
+                cout << "Enter dataset (expenses/incomes/aggregates), format (csv/jsonl/columnar), and output file: ";
+                getline(cin, dataset);
+                getline(cin, format);
+                getline(cin, path);
+                exportData(dataset, format, path);
+                break;
+            }
             case 0:
                 return;
             default: